@@ -0,0 +1,83 @@
+import multiprocessing
+import socket
+import sys
+import time
+
+from clientSoc import GET_BACKUP_LIST
+
+# uid that never backed up anything, so every request is answered with NO_CONTENT
+BENCH_UID = 2 ** 32 - 1
+
+
+def get_server_info():
+    """
+    retrieves server ip and port from the server.info file
+    """
+    fd = open('server.info', 'r')
+    info = fd.readline().strip().split(':')
+    fd.close()
+    return info[0], int(info[1])
+
+
+def worker(addr, port, duration, results):
+    """
+    opens a new connection for every request until duration seconds have passed.
+    each request is a GET_BACKUP_LIST header, the response is read before closing.
+    """
+    header = BENCH_UID.to_bytes(4, 'little')
+    header += (1).to_bytes(1, 'little')  # version
+    header += GET_BACKUP_LIST.to_bytes(1, 'little')
+    header += (0).to_bytes(2, 'little')  # name_len
+    header += (0).to_bytes(4, 'little')  # size
+
+    count = 0
+    errors = 0
+    end = time.monotonic() + duration
+
+    while time.monotonic() < end:
+        try:
+            sock = socket.create_connection((addr, port))
+            sock.sendall(header)
+            if sock.recv(1024):
+                count += 1
+            else:
+                errors += 1
+            sock.close()
+        except socket.error:
+            errors += 1
+
+    results.put((count, errors))
+
+
+def main():
+    """
+    connections/sec load generator.
+    usage: python3 bench.py [workers] [seconds]
+    run one worker process per server shard or more, on a machine (or cores) that
+    doesn't share cpus with the server.
+    """
+    workers = int(sys.argv[1]) if len(sys.argv) > 1 else multiprocessing.cpu_count()
+    duration = float(sys.argv[2]) if len(sys.argv) > 2 else 10
+    addr, port = get_server_info()
+
+    results = multiprocessing.Queue()
+    procs = [multiprocessing.Process(target=worker, args=(addr, port, duration, results))
+             for _ in range(workers)]
+    for p in procs:
+        p.start()
+
+    count = 0
+    errors = 0
+    for _ in procs:
+        c, e = results.get()
+        count += c
+        errors += e
+    for p in procs:
+        p.join()
+
+    print(f'{workers} workers, {duration}s: {count} connections, {errors} errors, '
+          f'{count / duration:.0f} conn/s')
+
+
+if __name__ == "__main__":
+    main()
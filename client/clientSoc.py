@@ -1,5 +1,6 @@
 from time import sleep
 import socket
+import select
 import random
 import os
 
@@ -15,7 +16,9 @@ return_codes = {'GET_FILE_SUC': 210,
                 'BACKUP_OR_DEL_FILE_SUC': 212,
                 'FILE_NOT_FOUND': 1001,
                 'NO_CONTENT': 1002,
-                'INTERNAL_ERROR': 1003}
+                'INTERNAL_ERROR': 1003,
+                'QUOTA_EXCEEDED': 1004,
+                'FILE_IN_USE': 1005}
 
 # The max buffer size
 buffer_size = 1024
@@ -142,11 +145,17 @@ class clientSoc:
     def send_file(self, fd):
         """
         reads file content in chunks of 1024 bytes and sends them to the server.
+        the server may reject the upload (quota / free space) before it reads the payload,
+        so we stop sending as soon as its reply is readable.
         """
         print('Uploading file..')
         chunk = True
 
         while chunk:
+            readable, _, _ = select.select([self.sock], [], [], 0)
+            if readable:
+                print('Server replied before the upload finished.')
+                return
             chunk = fd.read(buffer_size)
             if chunk:
                 try:
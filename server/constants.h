@@ -4,6 +4,18 @@
 #define SERVER_VERSION 1
 #define CLIENT_VERSION 1
 #define MAX_LENGTH 1024
+#define STATS_INTERVAL 5 // seconds between per-shard stats reports
+#define SHARD_WORKERS 16 // worker threads per shard, each runs one session at a time
+#define LOCK_FILE "server.lock"
+
+// Per uid storage quotas
+#define QUOTA_FILE "quotas.info"
+#define QUOTA_MAX_BYTES 1073741824ULL  // 1GiB per uid
+#define QUOTA_MAX_FILES 1024           // files per uid
+#define MIN_FREE_SPACE 67108864ULL     // keep 64MiB free on the backup volume
+#define QUOTA_BUCKETS 64               // locks the quotas are split between
+#define QUOTA_SAVE_INTERVAL 5          // seconds between saves of QUOTA_FILE
+#define REJECT_DRAIN_LIMIT 1048576     // payload bytes read and dropped after a rejection
 
 // OpCodes
 #define BACKUP_FILE 100
@@ -19,6 +31,8 @@
 #define FILE_NOT_FOUND 1001
 #define NO_CONTENT 1002
 #define INTERNAL_ERROR 1003
+#define QUOTA_EXCEEDED 1004
+#define FILE_IN_USE 1005
 
 #endif //CONSTANTS_H
 
@@ -1,22 +1,43 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdlib>
 #include <cmath>
+#include <fstream>
+#include <functional>
+#include <tuple>
 #include <iostream>
+#include <thread>
 #include <utility>
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/random/random_device.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 #include "constants.h"
 #include "server.h"
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
 using boost::asio::ip::tcp;
 
-std::list<uint32_t> clients; // will hold the ID's of all the clients that were connected
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+QuotaBucket quotaBuckets[QUOTA_BUCKETS];     // storage used by every uid, persisted in QUOTA_FILE
+std::atomic<uint64_t> pendingTotal{0};      // bytes reserved by all uploads in progress
+std::atomic<bool> quotasDirty{false};       // quotas changed since they were last saved
 
 
 /* process client's session */
-void session(tcp::socket sock) {
+void session(tcp::socket sock, Shard &shard) {
 
     boost::system::error_code error;
     uint8_t data[MAX_LENGTH] = {0};
@@ -52,9 +73,12 @@ void session(tcp::socket sock) {
         request->size = (request->size << 8) + data[offset + 1];
         request->size = (request->size << 8) + data[offset + 0];
 
-        /* if it's a new client */
-        if (!isClient(clients, request->uid))
-            clients.push_back(request->uid);
+        /* if it's a new client. the list is local to the shard that accepted us */
+        {
+            std::lock_guard<std::mutex> lock(shard.clientsLock);
+            if (!isClient(shard.clients, request->uid))
+                shard.clients.push_back(request->uid);
+        }
 
         /* if request isn't valid */
         if (!isValid(request)) {
@@ -71,7 +95,9 @@ void session(tcp::socket sock) {
     catch (std::exception &e) {
         std::cerr << "Exception in thread, session: " << e.what() << "\n";
     }
-    std::cout << "Session ended with status: " << std::to_string(response->status) << std::endl;
+    shard.completed.fetch_add(1, std::memory_order_relaxed);
+    std::cout << "Session ended with status: " << std::to_string(response->status)
+              << " (shard " << shard.id << ")" << std::endl;
 
     // making sure to delete the allocated objects for this session.
     delete (request);
@@ -103,6 +129,9 @@ uint16_t parseRequest(tcp::socket &sock, Request *request, Response *response) {
     std::string fileName = "";
     std::vector<uint8_t> header;
     std::vector<std::string> fileList;
+    bool existed = false;
+    uint64_t oldSize = 0;
+    boost::system::error_code ec;
 
     try {
         // different cases for different client operations
@@ -119,15 +148,31 @@ uint16_t parseRequest(tcp::socket &sock, Request *request, Response *response) {
                     return INTERNAL_ERROR;
                 }
 
+                path.append(std::to_string(request->uid));
+                path.append(request->filename);
+
+                // admission control. reject before reading any of the payload
+                retCode = admitBackup(request->uid, request->filename, path, request->size, oldSize, existed);
+                if (retCode) {
+                    std::cout << "Backup of " << request->filename << " rejected for uid " << request->uid
+                              << " with status: " << retCode << std::endl;
+                    header = reply(response, retCode);
+                    boost::asio::write(sock, boost::asio::buffer(header));
+                    drainPayload(sock, request->size);
+                    return retCode;
+                }
+
                 // check if there's backup directory for the client
                 if (!mkdir(request->uid)) {
                     std::cout << "Error opening client's directory" << std::endl;
+                    settleBackup(request->uid, request->filename, path, request->size, oldSize, existed);
                     header = reply(response, INTERNAL_ERROR);
                     boost::asio::write(sock, boost::asio::buffer(header));
                     return INTERNAL_ERROR;
                 }
 
                 response->status = backupFile(sock, request, response);
+                settleBackup(request->uid, request->filename, path, request->size, oldSize, existed);
 
                 header = reply(response, response->status, request->name_len, response->filename);
                 boost::asio::write(sock, boost::asio::buffer(header));
@@ -195,7 +240,18 @@ uint16_t parseRequest(tcp::socket &sock, Request *request, Response *response) {
                     return FILE_NOT_FOUND;
                 }
 
-                response->status = eraseFile(path);
+                // nobody may upload the file while it's being erased
+                if (!claimFile(request->uid, request->filename)) {
+                    std::cout << "Client's file is in use" << std::endl;
+                    header = reply(response, FILE_IN_USE);
+                    boost::asio::write(sock, boost::asio::buffer(header));
+                    return FILE_IN_USE;
+                }
+
+                oldSize = boost::filesystem::file_size(path, ec);
+                response->status = ec ? INTERNAL_ERROR : eraseFile(path);
+                releaseFile(request->uid, request->filename, response->status == ERASE_FILE_SUC ? oldSize : 0,
+                            response->status == ERASE_FILE_SUC);
                 header = reply(response, response->status, request->name_len, response->filename);
                 boost::asio::write(sock, boost::asio::buffer(header));
                 break;
@@ -249,7 +305,28 @@ uint16_t parseRequest(tcp::socket &sock, Request *request, Response *response) {
     return response->status;
 }
 
-/* backup the file in the client directory */
+/*
+ * reads and drops the payload of a rejected backup, at most REJECT_DRAIN_LIMIT bytes.
+ * closing the socket with unread data would reset the connection, and the client could
+ * lose the reply that tells it to stop sending.
+ */
+void drainPayload(tcp::socket &sock, uint32_t size) {
+    boost::system::error_code error;
+    uint8_t chunk[MAX_LENGTH];
+    uint64_t byteCount = 0;
+    uint64_t limit = std::min<uint64_t>(size, REJECT_DRAIN_LIMIT);
+
+    sock.shutdown(tcp::socket::shutdown_send, error);
+    while (!error && byteCount < limit)
+        byteCount += sock.read_some(boost::asio::buffer(chunk), error);
+}
+
+/*
+ * backup the file in the client directory.
+ * the client sends the header and then the payload. the server checks the quota right after
+ * the header, so a rejection reply can arrive before the payload was sent; the client should
+ * stop sending once a reply is readable.
+ */
 uint16_t backupFile(tcp::socket &sock, Request *request, Response *response) {
     boost::system::error_code error;
     uint32_t byteCount = 0;
@@ -543,55 +620,545 @@ bool mkdir(uint32_t uid) {
     }
 }
 
+/* returns the bucket that holds the quota of the given uid */
+QuotaBucket &quotaBucket(uint32_t uid) {
+    return quotaBuckets[uid % QUOTA_BUCKETS];
+}
+
+/* counts the regular files in a uid's backup directory and their total size */
+Quota scanUsage(const boost::filesystem::path &path) {
+    Quota quota;
+
+    try {
+        for (const auto &entry: boost::filesystem::directory_iterator(path)) {
+            if (!boost::filesystem::is_regular_file(entry.path()))
+                continue;
+            quota.bytes += boost::filesystem::file_size(entry.path());
+            quota.files++;
+        }
+    }
+    catch (const std::exception &e) {
+        std::cerr << "Exception in thread, scanUsage: " << e.what() << "\n";
+    }
+    return quota;
+}
+
+/*
+ * rebuilds the usage of every uid from the backup directories before the server accepts
+ * connections. QUOTA_FILE is only a cache of the last save: it misses whatever changed after
+ * it, and a crash can leave partial files behind, so uids that differ from it are reported.
+ */
+void loadQuotas() {
+    std::ifstream file(QUOTA_FILE);
+    std::unordered_map<uint32_t, std::pair<uint64_t, uint32_t>> cached;
+    uint32_t uid = 0;
+    uint64_t bytes = 0;
+    uint32_t files = 0;
+    size_t count = 0;
+
+    while (file >> uid >> bytes >> files)
+        cached[uid] = {bytes, files};
+
+    for (const auto &entry: boost::filesystem::directory_iterator(boost::filesystem::current_path())) {
+        std::string name = entry.path().filename().string();
+        if (!boost::filesystem::is_directory(entry.path()) || name.empty() || name.size() > 10 ||
+            !std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isdigit(c); }) ||
+            std::stoull(name) > UINT32_MAX)
+            continue;
+
+        uid = std::stoul(name);
+        Quota usage = scanUsage(entry.path());
+
+        auto it = cached.find(uid);
+        if (it == cached.end() || it->second != std::make_pair(usage.bytes, usage.files))
+            std::cout << "Quota of uid " << uid << " was out of date in " << QUOTA_FILE << std::endl;
+
+        QuotaBucket &bucket = quotaBucket(uid);
+        std::lock_guard<std::mutex> lock(bucket.lock);
+        bucket.quotas[uid] = usage;
+        count++;
+    }
+
+    quotasDirty = true;
+    std::cout << "Counted quotas for " << count << " uids" << std::endl;
+}
+
+/*
+ * writes a snapshot of the quotas to QUOTA_FILE. the buckets are locked one at a
+ * time only to copy them, the file is written without holding any lock.
+ */
+void saveQuotas() {
+    const std::string tmp = std::string(QUOTA_FILE) + ".tmp";
+    std::vector<std::tuple<uint32_t, uint64_t, uint32_t>> snapshot;
+
+    for (auto &bucket: quotaBuckets) {
+        std::lock_guard<std::mutex> lock(bucket.lock);
+        for (const auto &[uid, quota]: bucket.quotas)
+            snapshot.emplace_back(uid, quota.bytes, quota.files);
+    }
+
+    try {
+        std::ofstream file(tmp, std::ios::trunc);
+        if (!file)
+            throw std::runtime_error("Can't open " + tmp);
+
+        for (const auto &[uid, bytes, files]: snapshot)
+            file << uid << " " << bytes << " " << files << "\n";
+        file.close();
+        if (!file)
+            throw std::runtime_error("Can't write " + tmp);
+
+#ifdef __linux__
+        // make sure the new file is on disk before it replaces the old one
+        int fd = ::open(tmp.c_str(), O_RDONLY);
+        if (fd < 0 || ::fsync(fd) != 0) {
+            if (fd >= 0)
+                ::close(fd);
+            throw std::runtime_error("Can't sync " + tmp);
+        }
+        ::close(fd);
+#endif
+
+        // replace the old file only once the new one is complete
+        boost::filesystem::rename(tmp, QUOTA_FILE);
+    }
+    catch (const std::exception &e) {
+        std::cerr << "Exception in thread, saveQuotas: " << e.what() << "\n";
+        quotasDirty = true;
+    }
+}
+
+/*
+ * saves the quotas every QUOTA_SAVE_INTERVAL seconds if they've changed, and once more
+ * when the server is stopped with SIGINT or SIGTERM.
+ */
+void quotaSaver() {
+    boost::asio::io_context io_context;
+    boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+    boost::asio::steady_timer timer(io_context);
+    std::function<void()> schedule;
+
+    signals.async_wait([](const boost::system::error_code &error, int signal) {
+        if (error)
+            return;
+        std::cerr << "Got signal " << signal << ", saving quotas\n";
+        saveQuotas();
+        std::cout.flush();
+        std::_Exit(EXIT_SUCCESS);
+    });
+
+    schedule = [&timer, &schedule]() {
+        timer.expires_after(std::chrono::seconds(QUOTA_SAVE_INTERVAL));
+        timer.async_wait([&schedule](const boost::system::error_code &error) {
+            if (error)
+                return;
+            if (quotasDirty.exchange(false))
+                saveQuotas();
+            schedule();
+        });
+    };
+    schedule();
+
+    io_context.run();
+}
+
+/*
+ * returns the quota of the given uid. the usage of every uid with a backup directory is
+ * counted at startup, so a uid that isn't known yet has nothing stored.
+ * the caller must hold the uid's bucket lock
+ */
+Quota &getQuota(QuotaBucket &bucket, uint32_t uid) {
+    return bucket.quotas[uid];
+}
+
+/*
+ * marks the file as in use by the caller. returns false if another upload or erase
+ * of the same file is in progress. only the claimer may change the file's size.
+ */
+bool claimFile(uint32_t uid, const std::string &filename) {
+    QuotaBucket &bucket = quotaBucket(uid);
+    std::lock_guard<std::mutex> lock(bucket.lock);
+    return getQuota(bucket, uid).inUse.insert(filename).second;
+}
+
+/*
+ * checks the declared size of an upload against the uid's quota and the free space
+ * on the backup volume, counting every upload in progress. on success the file is
+ * claimed and the size is reserved until settleBackup() is called.
+ * returns 0 on success or the status to reply with.
+ */
+uint16_t admitBackup(uint32_t uid, const std::string &filename, const boost::filesystem::path &path,
+                     uint32_t size, uint64_t &oldSize, bool &existed) {
+    boost::system::error_code error;
+
+    if (!claimFile(uid, filename))
+        return FILE_IN_USE;
+
+    // the file is ours now, so it's safe to stat it without a lock
+    boost::filesystem::file_status status = boost::filesystem::status(path, error);
+    existed = boost::filesystem::exists(status);
+    if (existed && !boost::filesystem::is_regular_file(status)) {
+        releaseFile(uid, filename, 0, false);
+        return INTERNAL_ERROR;
+    }
+    oldSize = existed ? boost::filesystem::file_size(path, error) : 0;
+    if (existed && error) {
+        releaseFile(uid, filename, 0, false);
+        return INTERNAL_ERROR;
+    }
+
+    boost::filesystem::space_info space = boost::filesystem::space(boost::filesystem::current_path(), error);
+    if (error) {
+        releaseFile(uid, filename, 0, false);
+        return INTERNAL_ERROR;
+    }
+
+    uint64_t pending = pendingTotal.fetch_add(size) + size;
+    if (space.available < pending + MIN_FREE_SPACE) {
+        pendingTotal.fetch_sub(size);
+        releaseFile(uid, filename, 0, false);
+        return QUOTA_EXCEEDED;
+    }
+
+    QuotaBucket &bucket = quotaBucket(uid);
+    std::lock_guard<std::mutex> lock(bucket.lock);
+    Quota &quota = getQuota(bucket, uid);
+
+    // an existing file is overwritten, so its size is given back to the uid
+    uint64_t bytes = quota.bytes + quota.pendingBytes + size - std::min(oldSize, quota.bytes);
+    uint32_t files = quota.files + quota.pendingFiles + (existed ? 0 : 1);
+
+    if (bytes > QUOTA_MAX_BYTES || files > QUOTA_MAX_FILES) {
+        pendingTotal.fetch_sub(size);
+        quota.inUse.erase(filename);
+        return QUOTA_EXCEEDED;
+    }
+
+    quota.pendingBytes += size;
+    quota.pendingFiles += existed ? 0 : 1;
+    return 0;
+}
+
+/* drops the reservation and the claim of an upload and counts whatever actually ended up on disk */
+void settleBackup(uint32_t uid, const std::string &filename, const boost::filesystem::path &path,
+                  uint32_t size, uint64_t oldSize, bool existed) {
+    boost::system::error_code error;
+    bool exists = boost::filesystem::is_regular_file(path, error);
+    uint64_t newSize = exists ? boost::filesystem::file_size(path, error) : 0;
+    if (exists && error)
+        newSize = 0;
+
+    pendingTotal.fetch_sub(size);
+
+    QuotaBucket &bucket = quotaBucket(uid);
+    std::lock_guard<std::mutex> lock(bucket.lock);
+    Quota &quota = getQuota(bucket, uid);
+
+    quota.pendingBytes -= std::min<uint64_t>(size, quota.pendingBytes);
+    if (!existed && quota.pendingFiles)
+        quota.pendingFiles--;
+
+    quota.bytes = quota.bytes - std::min(oldSize, quota.bytes) + newSize;
+    if (!existed && exists)
+        quota.files++;
+    else if (existed && !exists && quota.files)
+        quota.files--;
+
+    quota.inUse.erase(filename);
+    quotasDirty = true;
+}
+
+/* drops the claim of a file. if it was erased, its storage is given back to the uid */
+void releaseFile(uint32_t uid, const std::string &filename, uint64_t size, bool erased) {
+    QuotaBucket &bucket = quotaBucket(uid);
+    std::lock_guard<std::mutex> lock(bucket.lock);
+    Quota &quota = getQuota(bucket, uid);
+
+    if (erased) {
+        quota.bytes -= std::min(size, quota.bytes);
+        if (quota.files)
+            quota.files--;
+        quotasDirty = true;
+    }
+    quota.inUse.erase(filename);
+}
+
 /* checks if a given client id exists in the given list */
-bool isClient(std::list<uint32_t> list, uint32_t id) {
-    for (std::list<uint32_t>::iterator it = list.begin(); it != list.end(); ++it) {
+bool isClient(const std::list<uint32_t> &list, uint32_t id) {
+    for (std::list<uint32_t>::const_iterator it = list.begin(); it != list.end(); ++it) {
         if (*it == id)
             return true;
     }
     return false;
 }
 
-/* listen for incoming connections and creates new thread for each new connection */
-void server(boost::asio::io_context &io_context, unsigned short port) {
-    tcp::acceptor a(io_context, tcp::endpoint(tcp::v4(), port));
-    for (;;) {
-        std::cout << "\n\n"
-                  << "Waiting to accept client connection"
-                  << "\n";
+/*
+ * makes sure no other server runs from this directory or listens on the port. SO_REUSEPORT would
+ * otherwise let a second instance bind the same port and take part of the traffic.
+ */
+void claimInstance(boost::interprocess::file_lock &lock, unsigned short port) {
+    std::ofstream(LOCK_FILE, std::ios::app);
+    lock = boost::interprocess::file_lock(LOCK_FILE);
+    if (!lock.try_lock())
+        throw std::runtime_error("Another server is already running in this directory.");
+
+    // a plain bind fails while any other socket listens on the port, SO_REUSEPORT or not
+    boost::asio::io_context io_context;
+    tcp::acceptor probe(io_context);
+    tcp::endpoint endpoint(tcp::v4(), port);
+    boost::system::error_code error;
 
-        std::thread(session, a.accept()).detach();
+    probe.open(endpoint.protocol());
+    probe.set_option(tcp::acceptor::reuse_address(true));
+    probe.bind(endpoint, error);
+    if (error)
+        throw std::runtime_error("Port " + std::to_string(port) + " is already in use: " + error.message());
+}
+
+/*
+ * opens the shard's acceptor. when reusePort is set, several shards bind the same port
+ * and the kernel spreads incoming connections between their acceptors.
+ */
+void openAcceptor(Shard &shard, unsigned short port, bool reusePort) {
+    tcp::endpoint endpoint(tcp::v4(), port);
+
+    shard.acceptor.open(endpoint.protocol());
+    shard.acceptor.set_option(tcp::acceptor::reuse_address(true));
+    if (reusePort) {
+#ifdef SO_REUSEPORT
+        shard.acceptor.set_option(reuse_port(true));
+#else
+        throw std::runtime_error("SO_REUSEPORT isn't supported on this platform.");
+#endif
+    }
+    shard.acceptor.bind(endpoint);
+    shard.acceptor.listen();
+}
 
-        std::cout << "Accepted "
+/*
+ * accepts the next connection on the shard's io_context. the session runs on the worker
+ * that accepted it, while the other workers of the shard keep accepting.
+ */
+void doAccept(Shard &shard) {
+    std::cout << "\n\n"
+              << "Waiting to accept client connection (shard " << shard.id << ")"
+              << "\n";
+
+    shard.acceptor.async_accept([&shard](const boost::system::error_code &error, tcp::socket sock) {
+        if (error == boost::asio::error::operation_aborted)
+            return;
+
+        doAccept(shard);
+        if (error) {
+            std::cerr << "Exception in thread, accept (shard " << shard.id << "): " << error.message() << "\n";
+            return;
+        }
+
+        std::cout << "Accepted (shard " << shard.id << ", total "
+                  << shard.accepted.fetch_add(1, std::memory_order_relaxed) + 1 << ")"
                   << "\n\n";
+        session(std::move(sock), shard);
+    });
+}
+
+/* runs the shard's io_context. a worker that fails takes the whole server down */
+void shardWorker(Shard &shard, bool pin) {
+    try {
+        if (pin && !pinToCore(shard.id))
+            std::cerr << "Can't pin shard " << shard.id << "\n";
+        shard.io_context.run();
+    }
+    catch (std::exception &e) {
+        std::cerr << "Exception in thread, shard " << shard.id << ": " << e.what() << "\n";
+        std::_Exit(EXIT_FAILURE);
     }
 }
 
+/*
+ * runs the shards, each with its own io_context, acceptor and SHARD_WORKERS worker threads.
+ * with more than one shard the acceptors share the port through SO_REUSEPORT. when pin is set,
+ * the workers of shard i are pinned to the i-th allowed core so its sessions (and the memory
+ * they touch first) stay on that core. every acceptor is opened before any worker starts, so
+ * a port that's in use fails the server. the calling thread reports the per-shard stats.
+ */
+void serverPool(unsigned short port, unsigned shards, bool pin) {
+    std::vector<std::unique_ptr<Shard>> pool;
+
+    for (unsigned i = 0; i < shards; i++) {
+        pool.push_back(std::make_unique<Shard>());
+        pool.back()->id = i;
+        openAcceptor(*pool.back(), port, shards > 1);
+    }
+
+    try {
+        for (auto &shard: pool) {
+            doAccept(*shard);
+            for (unsigned i = 0; i < SHARD_WORKERS; i++)
+                shard->workers.emplace_back(shardWorker, std::ref(*shard), pin);
+        }
+    }
+    catch (std::exception &e) {
+        // stop the workers that did start before giving up
+        for (auto &shard: pool) {
+            shard->io_context.stop();
+            for (auto &worker: shard->workers)
+                worker.join();
+        }
+        throw;
+    }
+
+    std::vector<uint64_t> lastAccepted(shards, 0);
+    std::vector<uint64_t> lastCompleted(shards, 0);
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::seconds(STATS_INTERVAL));
+        reportStats(pool, lastAccepted, lastCompleted);
+    }
+}
+
+/*
+ * prints the accepted/completed totals and accept rate of every shard whose counters changed
+ * since the last report. an idle server prints nothing.
+ */
+void reportStats(const std::vector<std::unique_ptr<Shard>> &pool, std::vector<uint64_t> &lastAccepted,
+                 std::vector<uint64_t> &lastCompleted) {
+    uint64_t total = 0;
+    bool changed = false;
+
+    for (const auto &shard: pool) {
+        uint64_t accepted = shard->accepted.load(std::memory_order_relaxed);
+        uint64_t completed = shard->completed.load(std::memory_order_relaxed);
+        if (accepted == lastAccepted[shard->id] && completed == lastCompleted[shard->id])
+            continue;
+
+        std::cerr << "Shard " << shard->id << ": accepted " << accepted << ", completed " << completed
+                  << ", " << (accepted - lastAccepted[shard->id]) / STATS_INTERVAL << " conn/s\n";
+
+        total += accepted - lastAccepted[shard->id];
+        lastAccepted[shard->id] = accepted;
+        lastCompleted[shard->id] = completed;
+        changed = true;
+    }
+    if (changed && pool.size() > 1)
+        std::cerr << "All shards: " << total / STATS_INTERVAL << " conn/s\n";
+}
+
+/* returns the cores this process is allowed to run on */
+std::vector<unsigned> allowedCores() {
+    std::vector<unsigned> cores;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                cores.push_back(cpu);
+        }
+    }
+#endif
+    return cores;
+}
+
+/* pins the calling thread to the index-th core of the allowed cpuset */
+bool pinToCore(unsigned index) {
+#ifdef __linux__
+    std::vector<unsigned> cores = allowedCores();
+    if (cores.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cores[index % cores.size()], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void) index;
+    return false;
+#endif
+}
+
+/* prints the usage of the server */
+void usage(const char *name) {
+    std::cerr << "usage: " << name << " [shards] [--pin] [--quiet]\n"
+              << "    shards   number of acceptor shards, 0 for one per allowed core (default 1)\n"
+              << "    --pin    pin every shard to its own core (Linux only)\n"
+              << "    --quiet  don't log every request to stdout\n";
+}
+
+/*
+ * parses the command line. returns false if an argument isn't valid.
+ * */
+bool parseArgs(int argc, char *argv[], unsigned &shards, bool &pin, bool &quiet) {
+    bool haveShards = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--pin")
+            pin = true;
+        else if (arg == "--quiet")
+            quiet = true;
+        else if (!haveShards && !arg.empty() &&
+                 std::all_of(arg.begin(), arg.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            if (arg.size() > 4)
+                return false;
+            shards = std::stoul(arg);
+            haveShards = true;
+        }
+        else
+            return false;
+    }
+
+    if (shards == 0) {
+        shards = allowedCores().size();
+        if (shards == 0)
+            shards = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return true;
+}
+
 /* clears the buffer */
 void clear_buffer(uint8_t *buf, uint32_t length) {
     for (uint32_t i = 0; i < length; i++)
         buf[i] = 0;
 }
 
+/*
+ * usage: ./server [shards] [--pin] [--quiet]
+ * */
 int main(int argc, char *argv[]) {
+    unsigned shards = 1;
+    bool pin = false;
+    bool quiet = false;
+    boost::interprocess::file_lock instanceLock;
+
     boost::filesystem::ifstream file;
     boost::filesystem::path path(boost::filesystem::current_path());
     const std::string port = "port.info";
     std::string portNum = "";
     // Try and search for the port.info file
     try {
+        if (!parseArgs(argc, argv, shards, pin, quiet)) {
+            usage(argv[0]);
+            return 1;
+        }
+        // stdout is shared by every session, silence it when measuring throughput
+        if (quiet)
+            std::cout.setstate(std::ios::failbit);
+
         if (!boost::filesystem::exists(port))
             throw std::runtime_error("port.info doesn't exist.");
         path.append(port);
         file.open(path, std::ios::out);
         if (!file)
             throw std::runtime_error("Can't open file" + port);
-        boost::asio::io_context io_context;
         getline(file, portNum);
         std::cout << "Starting Backup Server" << std::endl;
-        server(io_context, std::stoi(portNum));
+        claimInstance(instanceLock, std::stoi(portNum));
+        loadQuotas();
+        std::thread(quotaSaver).detach();
+        std::cout << "Running " << shards << " shard(s)" << (pin ? " (pinned)" : "") << std::endl;
+        serverPool(std::stoi(portNum), shards, pin);
     } catch (std::exception &e) {
         std::cerr << "Exception in main: " << e.what() << "\n";
+        return 1;
     }
     return 0;
 }
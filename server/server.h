@@ -1,9 +1,18 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <atomic>
 #include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <boost/asio.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
 
 using boost::asio::ip::tcp;
 
@@ -34,10 +43,62 @@ struct Request {
 };
 
 
+/*
+ * Storage used by a single uid. bytes and files are what's on disk,
+ * pendingBytes and pendingFiles are reserved by uploads in progress and
+ * inUse holds the files that are being uploaded or erased.
+ */
+struct Quota {
+    uint64_t bytes = 0;
+    uint32_t files = 0;
+    uint64_t pendingBytes = 0;
+    uint32_t pendingFiles = 0;
+    std::unordered_set<std::string> inUse;
+};
+
+/* the quotas are split between QUOTA_BUCKETS locks by uid, so sessions of different uids rarely contend */
+struct alignas(64) QuotaBucket {
+    std::mutex lock;
+    std::unordered_map<uint32_t, Quota> quotas;
+};
+
+
+/*
+ * One acceptor shard. each shard owns its own io_context, acceptor, worker
+ * threads and bookkeeping so that shards never touch each other's state.
+ * sessions accepted by a shard run on its workers and only update that
+ * shard's members.
+ */
+struct alignas(64) Shard {
+    unsigned id = 0;
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor{io_context};
+    std::vector<std::thread> workers;
+
+    // ID's of the clients that were connected through this shard
+    std::mutex clientsLock;
+    std::list<uint32_t> clients;
+
+    // stats
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> completed{0};
+};
+
+
 //server functions
-void server(boost::asio::io_context &io_context, unsigned short port);
-void session(tcp::socket sock);
-bool isClient(std::list<uint32_t> list, uint32_t id);
+void claimInstance(boost::interprocess::file_lock &lock, unsigned short port);
+void openAcceptor(Shard &shard, unsigned short port, bool reusePort);
+void doAccept(Shard &shard);
+void shardWorker(Shard &shard, bool pin);
+void serverPool(unsigned short port, unsigned shards, bool pin);
+void reportStats(const std::vector<std::unique_ptr<Shard>> &pool, std::vector<uint64_t> &lastAccepted,
+                 std::vector<uint64_t> &lastCompleted);
+std::vector<unsigned> allowedCores();
+bool pinToCore(unsigned index);
+void usage(const char *name);
+bool parseArgs(int argc, char *argv[], unsigned &shards, bool &pin, bool &quiet);
+void session(tcp::socket sock, Shard &shard);
+bool isClient(const std::list<uint32_t> &list, uint32_t id);
 bool isValid(Request *request);
 void clear_buffer(uint8_t *buf, uint32_t length);
 std::vector<uint8_t>
@@ -45,6 +106,7 @@ reply(Response *response, uint16_t status = 0, uint16_t nameLen = 0, std::string
       uint32_t size = 0);
 uint16_t parseRequest(tcp::socket &sock, Request *request, Response *response);
 bool mkdir(uint32_t uid);
+void drainPayload(tcp::socket &sock, uint32_t size);
 uint16_t backupFile(tcp::socket &sock, Request *request,Response *response);
 
 uint16_t retrieveFileFromBackup(tcp::socket &sock, Request *request, Response *response);
@@ -54,5 +116,19 @@ uint16_t sendBackupList(tcp::socket &sock,Request *request, Response *response,
 std::vector<std::string> getBackupList(boost::filesystem::path path);
 std::string generateRandomAlphaNum(const int len);
 
+// quota functions
+QuotaBucket &quotaBucket(uint32_t uid);
+Quota scanUsage(const boost::filesystem::path &path);
+void loadQuotas();
+void saveQuotas();
+void quotaSaver();
+Quota &getQuota(QuotaBucket &bucket, uint32_t uid);
+bool claimFile(uint32_t uid, const std::string &filename);
+uint16_t admitBackup(uint32_t uid, const std::string &filename, const boost::filesystem::path &path,
+                     uint32_t size, uint64_t &oldSize, bool &existed);
+void settleBackup(uint32_t uid, const std::string &filename, const boost::filesystem::path &path,
+                  uint32_t size, uint64_t oldSize, bool existed);
+void releaseFile(uint32_t uid, const std::string &filename, uint64_t size, bool erased);
+
 
 #endif //SERVER_H